@@ -15,6 +15,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // RUSAGE_THREAD
+#endif
+
 #include <getopt.h>
 #include <jack/jack.h>
 #include <jack/ringbuffer.h>
@@ -24,6 +28,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
 
 #ifndef WIN32
 #include <signal.h>
@@ -33,14 +40,97 @@ static jack_client_t*     j_client      = NULL;
 static jack_port_t*       j_output_port = NULL;
 static jack_port_t*       j_input_port  = NULL;
 static jack_ringbuffer_t* j_rb          = NULL;
+static jack_ringbuffer_t* j_fm          = NULL;
 static jack_nframes_t     j_samplerate  = 48000;
 
 static LTCEncoder* encoder = NULL;
 static LTCDecoder* decoder = NULL;
 
 static unsigned long int monotonic_cnt = 0;
+static unsigned long int stream_rpos   = 0; // samples read from j_rb
+static unsigned long int stream_wpos   = 0; // samples written to j_rb
+static unsigned long int emit_cnt      = 0; // frames sent
 static unsigned int      fps           = 25; // 24, 25 or 30
 static float             volume_dbfs   = -6.0;
+static int               accel         = 1; // LTC speed multiplier
+static int               narrowband    = 0; // 8-16kHz telephony profile
+static double            ltc_rate      = 1.0; // LTC speed relative to nominal
+static long int          max_delay     = 0; // samples, upper limit of valid delta
+static unsigned int      run_time      = 0; // seconds, 0: until interrupted
+static float             min_shift_ms  = 1.0; // smallest delay change counted as regression
+static unsigned int      res_interval  = 0; // seconds, 0: no resource report
+
+/* resource accounting, low/high-water marks */
+static size_t            rb_min_fill   = 0; // bytes in j_rb, at process()
+static unsigned long int underrun_cnt  = 0;
+static size_t            fm_max_fill   = 0; // bytes in j_fm
+static int               dec_queue_max = 0; // frames in decoder queue
+
+/* Frame-start marker.
+ * main_loop() passes the position of every generated frame in the j_rb
+ * sample-stream to process() using `tc` = frame-number since 00:00:00:00.
+ * process() replaces `pos` with the actual output position (monotonic_cnt)
+ * and stores it in emit_ring[], indexed by the timecode.
+ */
+typedef struct {
+	unsigned long int tc;
+	unsigned long int pos;
+} FrameMark;
+
+#define EMIT_RING_SIZE 1024 // > max frames in flight (precache + delay)
+
+static FrameMark emit_ring[EMIT_RING_SIZE];
+
+/* sparse histogram of measured delays, sorted by value */
+typedef struct {
+	long int          value;
+	unsigned long int count;
+	unsigned long int visits; // mode entered at this value, see mode_track()
+	unsigned long int exits;  // mode left from this value
+} HistBin;
+
+typedef struct {
+	HistBin*          bins;
+	size_t            n_bins;
+	size_t            n_alloc;
+	unsigned long int total;
+} Histogram;
+
+static Histogram delay_hist = { NULL, 0, 0, 0 };
+
+/* frame-start deltas since the signal was acquired */
+typedef struct {
+	double            sum;
+	double            sum2;
+	unsigned long int n;
+	unsigned long int last_seen;
+} DelayStats;
+
+static DelayStats delay_stats = { 0, 0, 0, 0 };
+
+/* Latency modes: the path alternates between distinct delays.
+ * Modes are clusters of the delay histogram: values within the
+ * tolerance of their neighbour belong to the same mode, modes are
+ * separated by gaps. Consecutive frames in different clusters count as
+ * a transition; a switch is confirmed after MODE_CONFIRM consecutive
+ * frames in another mode. Tracking starts after MODE_WARMUP frames,
+ * when the histogram is populated. */
+#define MODE_WARMUP 50
+#define MODE_CONFIRM 3
+#define MODE_MIN_OCCUPANCY 0.02
+
+typedef struct {
+	long int          tolerance; // samples
+	long int          prev;      // delay of the previous frame
+	long int          current;   // a delay in the confirmed mode
+	long int          candidate;
+	unsigned int      n_candidate;
+	unsigned long int transitions;
+	unsigned long int switches;
+	unsigned long int n; // frames tracked
+} ModeTracker;
+
+static ModeTracker mode_tracker;
 
 pthread_mutex_t ltc_thread_lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t  data_ready      = PTHREAD_COND_INITIALIZER;
@@ -49,11 +139,8 @@ static int active = 0; // 0: starting, 1:running, 2:shutdown
 static int debug  = 0;
 
 static int
-process (jack_nframes_t n_samples, void* arg)
+process_buffers (jack_default_audio_sample_t* in, jack_default_audio_sample_t* out, jack_nframes_t n_samples)
 {
-	jack_default_audio_sample_t* in  = jack_port_get_buffer (j_input_port, n_samples);
-	jack_default_audio_sample_t* out = jack_port_get_buffer (j_output_port, n_samples);
-
 	if (active != 1) {
 		memset (out, 0, sizeof (jack_default_audio_sample_t) * n_samples);
 		return 0;
@@ -61,13 +148,35 @@ process (jack_nframes_t n_samples, void* arg)
 
 	ltc_decoder_write_float (decoder, in, n_samples, monotonic_cnt);
 
-	if (jack_ringbuffer_read_space (j_rb) > sizeof (jack_default_audio_sample_t) * n_samples) {
+	const size_t rb_fill = jack_ringbuffer_read_space (j_rb);
+	if (rb_fill < rb_min_fill) {
+		rb_min_fill = rb_fill;
+	}
+
+	if (rb_fill > sizeof (jack_default_audio_sample_t) * n_samples) {
 		jack_ringbuffer_read (j_rb, (void*)out, sizeof (jack_default_audio_sample_t) * n_samples);
-		monotonic_cnt += n_samples;
+
+		/* record output position of frames starting in this cycle */
+		FrameMark fm;
+		while (jack_ringbuffer_read_space (j_fm) >= sizeof (FrameMark)) {
+			jack_ringbuffer_peek (j_fm, (void*)&fm, sizeof (FrameMark));
+			if (fm.pos >= stream_rpos + n_samples) {
+				break;
+			}
+			jack_ringbuffer_read_advance (j_fm, sizeof (FrameMark));
+			FrameMark* em = &emit_ring[fm.tc % EMIT_RING_SIZE];
+			em->pos       = monotonic_cnt + fm.pos - stream_rpos;
+			em->tc        = fm.tc;
+			++emit_cnt;
+		}
+		stream_rpos += n_samples;
 	} else {
 		memset (out, 0, sizeof (jack_default_audio_sample_t) * n_samples);
+		++underrun_cnt;
 	}
 
+	monotonic_cnt += n_samples;
+
 	if (pthread_mutex_trylock (&ltc_thread_lock) == 0) {
 		pthread_cond_signal (&data_ready);
 		pthread_mutex_unlock (&ltc_thread_lock);
@@ -75,6 +184,15 @@ process (jack_nframes_t n_samples, void* arg)
 	return 0;
 }
 
+static int
+process (jack_nframes_t n_samples, void* arg)
+{
+	jack_default_audio_sample_t* in  = jack_port_get_buffer (j_input_port, n_samples);
+	jack_default_audio_sample_t* out = jack_port_get_buffer (j_output_port, n_samples);
+
+	return process_buffers (in, out, n_samples);
+}
+
 static void
 cleanup (int term)
 {
@@ -87,6 +205,10 @@ cleanup (int term)
 		jack_ringbuffer_free (j_rb);
 	}
 
+	if (j_fm) {
+		jack_ringbuffer_free (j_fm);
+	}
+
 	ltc_encoder_free (encoder);
 	ltc_decoder_free (decoder);
 
@@ -97,6 +219,7 @@ cleanup (int term)
 
 	j_client = NULL;
 	j_rb     = NULL;
+	j_fm     = NULL;
 	encoder  = NULL;
 	decoder  = NULL;
 }
@@ -109,6 +232,18 @@ jack_shutdown (void* arg)
 	pthread_cond_signal (&data_ready);
 }
 
+static void
+init_buffers ()
+{
+	const size_t rbsize = j_samplerate * sizeof (jack_default_audio_sample_t);
+	j_rb                = jack_ringbuffer_create (rbsize);
+	jack_ringbuffer_mlock (j_rb);
+	memset (j_rb->buf, 0, rbsize);
+
+	j_fm = jack_ringbuffer_create (EMIT_RING_SIZE * sizeof (FrameMark));
+	jack_ringbuffer_mlock (j_fm);
+}
+
 static void
 init_jack ()
 {
@@ -138,10 +273,7 @@ init_jack ()
 		cleanup (1);
 	}
 
-	const size_t rbsize = j_samplerate * sizeof (jack_default_audio_sample_t);
-	j_rb                = jack_ringbuffer_create (rbsize);
-	jack_ringbuffer_mlock (j_rb);
-	memset (j_rb->buf, 0, rbsize);
+	init_buffers ();
 
 	if (jack_activate (j_client)) {
 		fprintf (stderr, "Error: Cannot activate client");
@@ -149,48 +281,624 @@ init_jack ()
 	}
 }
 
+/* the decoder needs a few samples per bit to reliably detect edges */
+#define MIN_SAMPLES_PER_BIT 6
+
+static void
+init_ltc ()
+{
+	/* Narrowband profile: half-speed LTC puts the fundamental at
+	 * fps * 20..40 Hz, well inside the 300..3400 Hz telephony band, with
+	 * twice as many samples per bit. Edges are smoothed to stay below
+	 * 3.4kHz and jitter-buffers may add more than a second of delay. */
+	if (narrowband) {
+		if (accel > 1) {
+			fprintf (stderr, "Warning: LTC acceleration is not available in narrowband mode.\n");
+		}
+		accel     = 1;
+		ltc_rate  = 0.5;
+		max_delay = 2 * j_samplerate;
+	} else {
+		const int req_accel = accel;
+		while (accel > 1 && j_samplerate / (80. * fps * accel) < MIN_SAMPLES_PER_BIT) {
+			--accel;
+		}
+		if (accel != req_accel) {
+			fprintf (stderr, "Warning: LTC acceleration reduced from x%d to x%d (%d samples per bit minimum at %u Hz).\n",
+			         req_accel, accel, MIN_SAMPLES_PER_BIT, j_samplerate);
+		}
+		ltc_rate  = accel;
+		max_delay = j_samplerate;
+	}
+
+	const double rise_time = narrowband ? 150.0 : 40.0 / ltc_rate; // usec
+	const double spb       = j_samplerate / (80 * fps * ltc_rate);
+
+	if (ltc_rate != 1.0) {
+		printf ("LTC rate x%.1f (%.0f samples per bit)\n", ltc_rate, spb);
+	}
+	if (spb < MIN_SAMPLES_PER_BIT) {
+		fprintf (stderr, "Warning: only %.1f samples per bit, LTC decoding may be unreliable%s.\n", spb,
+		         narrowband ? "" : " (try --narrowband)");
+	}
+
+	/* The timecode still counts at nominal fps, each frame is encoded in
+	 * 1/ltc_rate of the time. The encoder's filter is relative to its
+	 * sample-rate. */
+	encoder = ltc_encoder_create (j_samplerate / ltc_rate, fps, LTC_TV_FILM_24 /* no offset */, 0);
+	decoder = ltc_decoder_create (j_samplerate / (fps * ltc_rate), 12 * accel);
+	ltc_encoder_set_filter (encoder, rise_time * ltc_rate);
+}
+
+static unsigned long int
+frame_number (const SMPTETimecode* stime)
+{
+	return stime->frame + fps * (stime->hours * 3600 + stime->mins * 60 + stime->secs);
+}
+
+/* index of the first bin with a value >= `value` */
+static size_t
+hist_index (const Histogram* h, long int value)
+{
+	size_t lo = 0;
+	size_t hi = h->n_bins;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (h->bins[mid].value < value) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static void
+hist_add (Histogram* h, long int value, unsigned long int count)
+{
+	const size_t lo = hist_index (h, value);
+
+	h->total += count;
+
+	if (lo < h->n_bins && h->bins[lo].value == value) {
+		h->bins[lo].count += count;
+		return;
+	}
+
+	if (h->n_bins == h->n_alloc) {
+		h->n_alloc = h->n_alloc ? 2 * h->n_alloc : 64;
+		h->bins    = realloc (h->bins, h->n_alloc * sizeof (HistBin));
+	}
+
+	memmove (&h->bins[lo + 1], &h->bins[lo], (h->n_bins - lo) * sizeof (HistBin));
+	h->bins[lo].value  = value;
+	h->bins[lo].count  = count;
+	h->bins[lo].visits = 0;
+	h->bins[lo].exits  = 0;
+	++h->n_bins;
+}
+
+static void
+hist_free (Histogram* h)
+{
+	free (h->bins);
+	h->bins    = NULL;
+	h->n_bins  = 0;
+	h->n_alloc = 0;
+	h->total   = 0;
+}
+
+static void
+hist_stats (const Histogram* h, double* mean, double* stddev, long int* median)
+{
+	size_t i;
+	double sum  = 0;
+	double sum2 = 0;
+
+	*mean   = 0;
+	*stddev = 0;
+	*median = 0;
+
+	if (h->total == 0) {
+		return;
+	}
+
+	unsigned long int acc = 0;
+	for (i = 0; i < h->n_bins; ++i) {
+		sum += h->bins[i].value * (double)h->bins[i].count;
+		if (acc < (h->total + 1) / 2 && acc + h->bins[i].count >= (h->total + 1) / 2) {
+			*median = h->bins[i].value;
+		}
+		acc += h->bins[i].count;
+	}
+	*mean = sum / h->total;
+
+	for (i = 0; i < h->n_bins; ++i) {
+		const double d = h->bins[i].value - *mean;
+		sum2 += d * d * h->bins[i].count;
+	}
+	*stddev = sqrt (sum2 / h->total);
+}
+
+/* two-sample Kolmogorov-Smirnov test, returns the significance level
+ * (p-value) of the null-hypothesis that both are drawn from the same
+ * distribution. */
+static double
+hist_ks_test (const Histogram* a, const Histogram* b, double* d_max)
+{
+	size_t            ia = 0, ib = 0;
+	unsigned long int ca = 0, cb = 0;
+
+	*d_max = 0;
+	if (a->total == 0 || b->total == 0) {
+		return 1.0;
+	}
+
+	while (ia < a->n_bins || ib < b->n_bins) {
+		long int v;
+		if (ib >= b->n_bins || (ia < a->n_bins && a->bins[ia].value <= b->bins[ib].value)) {
+			v = a->bins[ia].value;
+		} else {
+			v = b->bins[ib].value;
+		}
+		if (ia < a->n_bins && a->bins[ia].value == v) {
+			ca += a->bins[ia++].count;
+		}
+		if (ib < b->n_bins && b->bins[ib].value == v) {
+			cb += b->bins[ib++].count;
+		}
+		const double d = fabs (ca / (double)a->total - cb / (double)b->total);
+		if (d > *d_max) {
+			*d_max = d;
+		}
+	}
+
+	/* asymptotic distribution, see Numerical Recipes 14.3 */
+	const double ne     = a->total * (double)b->total / (a->total + b->total);
+	const double lambda = (sqrt (ne) + 0.12 + 0.11 / sqrt (ne)) * *d_max;
+	const double a2     = -2.0 * lambda * lambda;
+
+	int    j;
+	double fac  = 2.0;
+	double sum  = 0;
+	double term = 0;
+	double prev = 0;
+	for (j = 1; j <= 100; ++j) {
+		term = fac * exp (a2 * j * j);
+		sum += term;
+		if (fabs (term) <= 1e-3 * prev || fabs (term) <= 1e-8 * sum) {
+			return sum > 1.0 ? 1.0 : sum;
+		}
+		fac  = -fac;
+		prev = fabs (term);
+	}
+	return 1.0; // no convergence, d_max is tiny
+}
+
+static int
+hist_save (const char* fn, const Histogram* h, const char* input_port, const char* output_port)
+{
+	size_t i;
+	FILE*  f = fopen (fn, "w");
+	if (!f) {
+		fprintf (stderr, "Error: Cannot write baseline '%s'\n", fn);
+		return -1;
+	}
+	fprintf (f, "# ltc-delay baseline: <delay> <count>\n");
+	fprintf (f, "samplerate %u\n", j_samplerate);
+	fprintf (f, "input %s\n", input_port ? input_port : "");
+	fprintf (f, "output %s\n", output_port ? output_port : "");
+	for (i = 0; i < h->n_bins; ++i) {
+		fprintf (f, "%ld %lu\n", h->bins[i].value, h->bins[i].count);
+	}
+	fclose (f);
+	return 0;
+}
+
+/* copy the rest of the line after `key ` to `val`, returns 0 on match */
+static int
+parse_string (const char* line, const char* key, char* val, size_t len)
+{
+	const size_t kl = strlen (key);
+	if (strncmp (line, key, kl) || line[kl] != ' ') {
+		return -1;
+	}
+	strncpy (val, &line[kl + 1], len - 1);
+	val[len - 1]              = '\0';
+	val[strcspn (val, "\r\n")] = '\0';
+	return 0;
+}
+
+static int
+hist_load (const char* fn, Histogram* h, unsigned int* samplerate, char* input_port, char* output_port, size_t len)
+{
+	char  line[1024];
+	FILE* f = fopen (fn, "r");
+	if (!f) {
+		fprintf (stderr, "Error: Cannot read baseline '%s'\n", fn);
+		return -1;
+	}
+	*samplerate    = 0;
+	input_port[0]  = '\0';
+	output_port[0] = '\0';
+	while (fgets (line, sizeof (line), f)) {
+		long int          value;
+		unsigned long int count;
+		if (line[0] == '#') {
+			continue;
+		} else if (sscanf (line, "samplerate %u", samplerate) == 1) {
+			continue;
+		} else if (!parse_string (line, "input", input_port, len)) {
+			continue;
+		} else if (!parse_string (line, "output", output_port, len)) {
+			continue;
+		} else if (sscanf (line, "%ld %lu", &value, &count) == 2) {
+			hist_add (h, value, count);
+		}
+	}
+	fclose (f);
+
+	if (*samplerate == 0 || h->total == 0) {
+		fprintf (stderr, "Error: '%s' is not a valid baseline\n", fn);
+		return -1;
+	}
+	return 0;
+}
+
+/* Compare measurement with baseline, return 1 on regression.
+ * A regression is an increase of the mean delay that is statistically
+ * significant and larger than min_shift_ms. Changes of the spread are
+ * reported but do not fail. */
+static int
+compare_baseline (const Histogram* base, const Histogram* cur)
+{
+	const double alpha = 0.01;
+
+	double   b_mean, b_stddev, c_mean, c_stddev, d_max;
+	long int b_median, c_median;
+
+	hist_stats (base, &b_mean, &b_stddev, &b_median);
+	hist_stats (cur, &c_mean, &c_stddev, &c_median);
+
+	printf ("Baseline: %8lu frames, mean %.1f, stddev %.2f, median %ld\n",
+	        base->total, b_mean, b_stddev, b_median);
+	printf ("Current:  %8lu frames, mean %.1f, stddev %.2f, median %ld\n",
+	        cur->total, c_mean, c_stddev, c_median);
+
+	if (cur->total == 0) {
+		printf ("No delay was measured.\n");
+		return 1;
+	}
+
+	const double p        = hist_ks_test (base, cur, &d_max);
+	const double shift    = c_mean - b_mean;
+	const double shift_ms = 1000. * shift / j_samplerate;
+
+	printf ("Difference: mean %+.1f (%+.3f ms), stddev %+.2f, KS D=%.3f p=%.3g\n",
+	        shift, shift_ms, c_stddev - b_stddev, d_max, p);
+
+	if (p >= alpha) {
+		printf ("No significant change.\n");
+		return 0;
+	}
+	if (fabs (shift_ms) <= min_shift_ms) {
+		printf ("Significant change, but mean delay shift is within %.2f ms.\n", min_shift_ms);
+		return 0;
+	}
+	if (shift > 0) {
+		printf ("Significant regression: delay increased by %.3f ms.\n", shift_ms);
+		return 1;
+	}
+	printf ("Significant improvement: delay decreased by %.3f ms.\n", -shift_ms);
+	return 0;
+}
+
+static double
+timespec_sec (const struct timespec* ts)
+{
+	return ts->tv_sec + ts->tv_nsec * 1e-9;
+}
+
+static double
+timeval_sec (const struct timeval* tv)
+{
+	return tv->tv_sec + tv->tv_usec * 1e-6;
+}
+
+/* report the tool's own resource usage */
+static void
+print_resources (unsigned long int now)
+{
+	struct rusage ru;
+
+	const double elapsed = now / (double)j_samplerate;
+
+	getrusage (RUSAGE_SELF, &ru);
+	const double cpu_total = timeval_sec (&ru.ru_utime) + timeval_sec (&ru.ru_stime);
+
+	printf ("Resources: cpu %.3fs (%.2f%%)", cpu_total, elapsed > 0 ? 100. * cpu_total / elapsed : 0);
+
+#ifdef _POSIX_THREAD_CPUTIME
+	struct timespec ts;
+	clockid_t       cid;
+	if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+		printf (", main %.3fs", timespec_sec (&ts));
+	}
+	if (j_client && pthread_getcpuclockid (jack_client_thread_id (j_client), &cid) == 0 && clock_gettime (cid, &ts) == 0) {
+		printf (", jack %.3fs", timespec_sec (&ts));
+	}
+#endif
+
+	printf (" | ctxsw %ld/%ld", ru.ru_nvcsw, ru.ru_nivcsw);
+#ifdef RUSAGE_THREAD
+	struct rusage rt;
+	if (getrusage (RUSAGE_THREAD, &rt) == 0) {
+		printf (" (main %ld/%ld)", rt.ru_nvcsw, rt.ru_nivcsw);
+	}
+#endif
+	printf (" | faults %ld/%ld", ru.ru_minflt, ru.ru_majflt);
+
+#ifdef __linux__
+	/* ru_maxrss is in kB on Linux, current RSS from /proc */
+	long int rss_pages = 0;
+	FILE*    f         = fopen ("/proc/self/statm", "r");
+	if (f) {
+		if (fscanf (f, "%*s %ld", &rss_pages) != 1) {
+			rss_pages = 0;
+		}
+		fclose (f);
+	}
+	printf (" | rss %ldkB (max %ldkB)", rss_pages * (sysconf (_SC_PAGESIZE) / 1024), ru.ru_maxrss);
+#else
+	printf (" | maxrss %ld", ru.ru_maxrss);
+#endif
+
+	printf (" | rb min %.2fs, underruns %lu | marks max %zu | queue max %d/%d | hist %zu\n",
+	        rb_min_fill / (double)(sizeof (jack_default_audio_sample_t) * j_samplerate),
+	        underrun_cnt,
+	        fm_max_fill / sizeof (FrameMark),
+	        dec_queue_max, 12 * accel,
+	        delay_hist.n_bins);
+}
+
+static void
+stats_add (DelayStats* ds, long int delta, unsigned long int now)
+{
+	ds->sum += delta;
+	ds->sum2 += delta * (double)delta;
+	++ds->n;
+	ds->last_seen = now;
+}
+
+static void
+stats_reset (DelayStats* ds)
+{
+	ds->sum  = 0;
+	ds->sum2 = 0;
+	ds->n    = 0;
+}
+
+/* mean delay and half-width of its 95% confidence interval */
+static void
+stats_mean (const DelayStats* ds, double* mean, double* ci95)
+{
+	*mean      = ds->sum / ds->n;
+	double var = ds->sum2 / ds->n - *mean * *mean;
+	/* integer sample positions: at least quantization noise */
+	if (var < 1. / 12.) {
+		var = 1. / 12.;
+	}
+	*ci95 = 1.96 * sqrt (var / ds->n);
+}
+
+static void
+mode_init (ModeTracker* m, long int tolerance)
+{
+	memset (m, 0, sizeof (ModeTracker));
+	m->tolerance = tolerance;
+}
+
+/* true if no gap larger than the tolerance separates a and b */
+static int
+hist_same_cluster (const Histogram* h, long int a, long int b, long int tolerance)
+{
+	if (a > b) {
+		const long int t = a;
+		a                = b;
+		b                = t;
+	}
+	if (b - a <= tolerance) {
+		return 1;
+	}
+
+	size_t i;
+	for (i = hist_index (h, a); i + 1 < h->n_bins && h->bins[i].value < b; ++i) {
+		if (h->bins[i + 1].value - h->bins[i].value > tolerance) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* `delta` must already be in the histogram */
+static void
+mode_track (ModeTracker* m, Histogram* h, long int delta)
+{
+	if (h->total <= MODE_WARMUP) {
+		m->prev    = delta;
+		m->current = delta;
+		return;
+	}
+
+	/* frame-to-frame transitions */
+	if (m->n++ == 0) {
+		++h->bins[hist_index (h, delta)].visits;
+	} else if (!hist_same_cluster (h, m->prev, delta, m->tolerance)) {
+		++h->bins[hist_index (h, m->prev)].exits;
+		++h->bins[hist_index (h, delta)].visits;
+		++m->transitions;
+	}
+	m->prev = delta;
+
+	/* confirmed switches */
+	if (hist_same_cluster (h, m->current, delta, m->tolerance)) {
+		m->current     = delta;
+		m->n_candidate = 0;
+		return;
+	}
+
+	if (m->n_candidate > 0 && hist_same_cluster (h, m->candidate, delta, m->tolerance)) {
+		++m->n_candidate;
+	} else {
+		m->candidate   = delta;
+		m->n_candidate = 1;
+	}
+
+	if (m->n_candidate >= MODE_CONFIRM) {
+		m->current     = delta;
+		m->n_candidate = 0;
+		++m->switches;
+	}
+}
+
+/* Cluster the histogram, returns the number of modes with significant
+ * occupancy, optionally prints them. */
+static int
+hist_modes (const Histogram* h, long int tolerance, int print)
+{
+	size_t            i;
+	int               n_modes = 0;
+	double            sum     = 0;
+	unsigned long int count   = 0;
+	unsigned long int visits  = 0;
+	unsigned long int exits   = 0;
+
+	const double frame_rate = fps * ltc_rate;
+
+	for (i = 0; i < h->n_bins; ++i) {
+		sum += h->bins[i].value * (double)h->bins[i].count;
+		count += h->bins[i].count;
+		visits += h->bins[i].visits;
+		exits += h->bins[i].exits;
+		if (i + 1 < h->n_bins && h->bins[i + 1].value - h->bins[i].value <= tolerance) {
+			continue;
+		}
+		if (count >= MODE_MIN_OCCUPANCY * h->total) {
+			if (print) {
+				const double in_mode = count / frame_rate; // seconds
+				printf ("%s %.0f (%.1f%%, %.2f exits/s, dwell %.3fs)",
+				        n_modes ? "," : "",
+				        sum / count,
+				        100. * count / h->total,
+				        exits / in_mode,
+				        in_mode / (visits > 0 ? visits : 1));
+			}
+			++n_modes;
+		}
+		sum    = 0;
+		count  = 0;
+		visits = 0;
+		exits  = 0;
+	}
+	return n_modes;
+}
+
+/* print latency modes, if there is more than one */
+static void
+print_modes (const Histogram* h, const ModeTracker* m)
+{
+	if (m->n == 0 || hist_modes (h, m->tolerance, 0) < 2) {
+		return;
+	}
+
+	const double seconds = m->n / (fps * ltc_rate);
+
+	printf ("Modes:");
+	hist_modes (h, m->tolerance, 1);
+	printf (" | %lu transitions (%.2f/s), %lu confirmed switches (%.2f/s)\n",
+	        m->transitions, m->transitions / seconds,
+	        m->switches, m->switches / seconds);
+}
+
+/* generate LTC until `precache` samples are queued for output */
+static void
+fill_ringbuffer (ltcsnd_sample_t* enc_buf, float smult, unsigned int precache)
+{
+	while (jack_ringbuffer_read_space (j_rb) < (precache * sizeof (jack_default_audio_sample_t))) {
+		SMPTETimecode etime;
+		FrameMark     fm;
+		ltc_encoder_get_timecode (encoder, &etime);
+		fm.tc  = frame_number (&etime);
+		fm.pos = stream_wpos;
+
+		/* the mark must be queued before the frame's first sample */
+		if (jack_ringbuffer_write (j_fm, (void*)&fm, sizeof (FrameMark)) != sizeof (FrameMark)) {
+			fprintf (stderr, "ERROR: frame-mark overflow\n");
+		}
+
+		int byteCnt;
+		for (byteCnt = 0; byteCnt < 10; byteCnt++) {
+			int i;
+			ltc_encoder_encode_byte (encoder, byteCnt, 1.0);
+			const int len = ltc_encoder_get_buffer (encoder, enc_buf);
+			for (i = 0; i < len; i++) {
+				const float v1 = enc_buf[i] - 128;
+
+				jack_default_audio_sample_t val = (jack_default_audio_sample_t) (v1 * smult);
+
+				if (jack_ringbuffer_write (j_rb, (void*)&val, sizeof (jack_default_audio_sample_t)) != sizeof (jack_default_audio_sample_t)) {
+					fprintf (stderr, "ERROR: ringbuffer overflow\n");
+				} else {
+					++stream_wpos;
+				}
+			}
+		}
+		ltc_encoder_inc_timecode (encoder);
+
+		const size_t fm_fill = jack_ringbuffer_read_space (j_fm);
+		if (fm_fill > fm_max_fill) {
+			fm_max_fill = fm_fill;
+		}
+	}
+}
+
 static void
 main_loop (void)
 {
 	/* default range from libltc (38..218) || - 128.0  -> (-90..90) */
-	const float        smult      = pow (10, volume_dbfs / 20.0) / 90.0;
-	const unsigned int precache   = j_samplerate / 2;
-	const unsigned int wraparound = 86400 * j_samplerate / fps; // 24h
-	ltcsnd_sample_t*   enc_buf    = calloc (ltc_encoder_get_buffersize (encoder), sizeof (ltcsnd_sample_t));
+	const float        smult    = pow (10, volume_dbfs / 20.0) / 90.0;
+	const unsigned int precache = j_samplerate / 2;
+	ltcsnd_sample_t*   enc_buf  = calloc (ltc_encoder_get_buffersize (encoder), sizeof (ltcsnd_sample_t));
+
+	int i;
+	for (i = 0; i < EMIT_RING_SIZE; ++i) {
+		emit_ring[i].tc = -1;
+	}
+
+	mode_init (&mode_tracker, j_samplerate / 1000 > 2 ? j_samplerate / 1000 : 2); // 1 ms
+
+	/* initial fill, resource accounting starts when output begins */
+	fill_ringbuffer (enc_buf, smult, precache);
+	rb_min_fill  = j_rb->size;
+	underrun_cnt = 0;
 
 	pthread_mutex_lock (&ltc_thread_lock);
 	active = 1;
 
-	double       avg_delta = 0;
-	unsigned int avg_count = 0;
-
-	unsigned long int last_signal      = 0;
 	unsigned long int last_notify_time = 0;
+	unsigned long int last_emit_cnt    = 0;
+	unsigned long int last_res_time    = 0;
+	unsigned int      n_recv           = 0;
 
 	const unsigned long int notify_dt = j_samplerate / 2;
 
 	while (active == 1) {
-		while (jack_ringbuffer_read_space (j_rb) < (precache * sizeof (jack_default_audio_sample_t))) {
-			int byteCnt;
-			for (byteCnt = 0; byteCnt < 10; byteCnt++) {
-				int i;
-				ltc_encoder_encode_byte (encoder, byteCnt, 1.0);
-				const int len = ltc_encoder_get_buffer (encoder, enc_buf);
-				for (i = 0; i < len; i++) {
-					const float v1 = enc_buf[i] - 128;
-
-					jack_default_audio_sample_t val = (jack_default_audio_sample_t) (v1 * smult);
-
-					if (jack_ringbuffer_write (j_rb, (void*)&val, sizeof (jack_default_audio_sample_t)) != sizeof (jack_default_audio_sample_t)) {
-						fprintf (stderr, "ERROR: ringbuffer overflow\n");
-					}
-				}
-			}
-			ltc_encoder_inc_timecode (encoder);
-		}
+		fill_ringbuffer (enc_buf, smult, precache);
 
-		int i;
 		int frames_in_queue = ltc_decoder_queue_length (decoder);
+		if (frames_in_queue > dec_queue_max) {
+			dec_queue_max = frames_in_queue;
+		}
 
 		const unsigned long int now = monotonic_cnt; // volatile
 
@@ -200,15 +908,20 @@ main_loop (void)
 			ltc_decoder_read (decoder, &frame);
 			ltc_frame_to_time (&stime, &frame.ltc, 0);
 
-			unsigned long int spos = stime.frame + fps * (stime.hours * 3600 + stime.mins * 60 + stime.secs);
-			spos *= j_samplerate / (double)fps;
+			/* compare to the actual output position of the frame */
+			const unsigned long int tc = frame_number (&stime);
+			const FrameMark*        em = &emit_ring[tc % EMIT_RING_SIZE];
 
-			long int delta = (frame.off_start % wraparound) - spos;
+			long int delta = -1;
+			if (em->tc == tc) {
+				delta = frame.off_start - (ltc_off_t)em->pos;
+			}
 
-			if (delta > 0 && delta < j_samplerate) {
-				avg_delta += delta;
-				++avg_count;
-				last_signal = now;
+			if (delta > 0 && delta < max_delay) {
+				stats_add (&delay_stats, delta, now);
+				hist_add (&delay_hist, delta, 1);
+				mode_track (&mode_tracker, &delay_hist, delta);
+				++n_recv;
 			}
 
 			if (debug) {
@@ -228,15 +941,38 @@ main_loop (void)
 
 		if (now > last_notify_time + notify_dt) {
 			last_notify_time = now;
-			if (now - last_signal > 3 * j_samplerate) {
-				avg_delta = 0;
-				avg_count = 0;
+			if (now - delay_stats.last_seen > 3 * j_samplerate) {
+				stats_reset (&delay_stats);
 			}
-			if (avg_count > 0) {
-				printf ("Delay %.0f\n", avg_delta / avg_count);
+			if (delay_stats.n > 0) {
+				double delay, ci95;
+				stats_mean (&delay_stats, &delay, &ci95);
+				printf ("Delay %.1f +/- %.1f", delay, ci95);
 			} else {
-				printf (" -- no recent signal\n");
+				printf (" -- no recent signal");
 			}
+			/* in accelerated mode, report if the path can carry the edge-rate */
+			const unsigned long int n_sent = emit_cnt - last_emit_cnt;
+			if (accel > 1 && n_sent > 0) {
+				const float rx = 100.f * n_recv / n_sent;
+				printf (" | x%d: %.0f%% frames decoded%s", accel, rx,
+				        rx < 90 ? " -- path cannot carry accelerated LTC" : "");
+			}
+			printf ("\n");
+			if (delay_stats.n > 0) {
+				print_modes (&delay_hist, &mode_tracker);
+			}
+			last_emit_cnt = emit_cnt;
+			n_recv        = 0;
+		}
+
+		if (res_interval > 0 && now >= last_res_time + res_interval * (unsigned long int)j_samplerate) {
+			last_res_time = now;
+			print_resources (now);
+		}
+
+		if (run_time > 0 && now >= run_time * (unsigned long int)j_samplerate) {
+			active = 2;
 		}
 
 		if (active != 1) {
@@ -250,6 +986,152 @@ main_loop (void)
 	pthread_mutex_unlock (&ltc_thread_lock);
 }
 
+/* Offline accuracy test: a simulated path replaces JACK.
+ * The path delays the signal by a known number of samples, in narrowband
+ * mode it adds a 300..3400 Hz linear-phase band-pass and G.711 mu-law
+ * quantization. */
+#define SELFTEST_TAPS 63
+
+typedef struct {
+	float*            buf;
+	size_t            size;
+	unsigned long int delay; // samples, >= block-size
+	float             fir[SELFTEST_TAPS];
+	float             state[SELFTEST_TAPS];
+} SelftestPath;
+
+static void
+selftest_design_fir (float* fir, double f_lo, double f_hi)
+{
+	int       i;
+	const int mid = (SELFTEST_TAPS - 1) / 2;
+	for (i = 0; i < SELFTEST_TAPS; ++i) {
+		const int    k   = i - mid;
+		const double win = 0.54 - 0.46 * cos (2 * M_PI * i / (SELFTEST_TAPS - 1)); // Hamming
+		double       h;
+		if (k == 0) {
+			h = 2 * (f_hi - f_lo);
+		} else {
+			h = (sin (2 * M_PI * f_hi * k) - sin (2 * M_PI * f_lo * k)) / (M_PI * k);
+		}
+		fir[i] = h * win;
+	}
+}
+
+static float
+selftest_mulaw (float x)
+{
+	const float mu = 255.f;
+	const float s  = x < 0 ? -1.f : 1.f;
+	float       y  = log1pf (mu * fminf (fabsf (x), 1.f)) / log1pf (mu);
+	y              = rintf (y * 127.f) / 127.f;
+	return s * (powf (1.f + mu, y) - 1.f) / mu;
+}
+
+static void*
+selftest_thread (void* arg)
+{
+	SelftestPath*               path      = (SelftestPath*)arg;
+	const jack_nframes_t        n_samples = 256;
+	const size_t                precache  = j_samplerate / 2 * sizeof (jack_default_audio_sample_t);
+	unsigned long int           t         = 0;
+	jack_default_audio_sample_t in[256];
+	jack_default_audio_sample_t out[256];
+	jack_nframes_t              i;
+
+	/* wait for main_loop() to start */
+	while (active == 0) {
+		usleep (1000);
+	}
+
+	while (active != 2) {
+		for (i = 0; i < n_samples; ++i) {
+			in[i] = path->buf[(t + i + path->size - path->delay) % path->size];
+		}
+
+		process_buffers (in, out, n_samples);
+
+		for (i = 0; i < n_samples; ++i) {
+			float y = out[i];
+			if (narrowband) {
+				int k;
+				memmove (&path->state[1], &path->state[0], (SELFTEST_TAPS - 1) * sizeof (float));
+				path->state[0] = y;
+				for (k = 0, y = 0; k < SELFTEST_TAPS; ++k) {
+					y += path->fir[k] * path->state[k];
+				}
+				y = selftest_mulaw (y);
+			}
+			path->buf[(t + i) % path->size] = y;
+		}
+		t += n_samples;
+
+		/* wait for main_loop() to refill the buffer, as it would in realtime */
+		do {
+			pthread_mutex_lock (&ltc_thread_lock);
+			pthread_cond_signal (&data_ready);
+			pthread_mutex_unlock (&ltc_thread_lock);
+		} while (active == 1 && jack_ringbuffer_read_space (j_rb) < precache && usleep (100) == 0);
+	}
+	return NULL;
+}
+
+static int
+selftest (void)
+{
+	pthread_t    thread;
+	SelftestPath path;
+
+	memset (&path, 0, sizeof (SelftestPath));
+	path.delay = j_samplerate / 10 + 37;
+	path.size  = 4 * j_samplerate;
+	path.buf   = calloc (path.size, sizeof (float));
+
+	unsigned long int expected = path.delay;
+	if (narrowband) {
+		selftest_design_fir (path.fir, 300. / j_samplerate, fminf (3400., .45 * j_samplerate) / j_samplerate);
+		expected += (SELFTEST_TAPS - 1) / 2;
+	}
+
+	if (run_time == 0) {
+		run_time = 10;
+	}
+
+	printf ("Self-test: %u Hz, %s profile, %u sec\n", j_samplerate, narrowband ? "narrowband" : "default", run_time);
+
+	pthread_create (&thread, NULL, selftest_thread, &path);
+	main_loop ();
+	pthread_join (thread, NULL);
+	free (path.buf);
+
+	double   mean, stddev;
+	long int median;
+	hist_stats (&delay_hist, &mean, &stddev, &median);
+
+	if (delay_hist.total == 0) {
+		printf ("Self-test FAILED: no delay measured.\n");
+		return 1;
+	}
+
+	/* frames still in the path or used by the decoder to sync are not counted */
+	const double frame_len = j_samplerate / (fps * ltc_rate);
+	const double n_sent    = emit_cnt - ceil ((expected + frame_len) / frame_len) - 1;
+	const double received  = n_sent > 0 ? delay_hist.total / n_sent : 0;
+
+	/* judge the frame-start deltas, median is robust to decoder glitches */
+	const long int error = median - (long int)expected;
+
+	printf ("Self-test: expected %lu, measured median %ld (mean %.1f, stddev %.2f), error %+ld samples, %.0f%% frames decoded\n",
+	        expected, median, mean, stddev, error, 100 * received);
+
+	if (labs (error) > 1 || received < 0.9) {
+		printf ("Self-test FAILED.\n");
+		return 1;
+	}
+	printf ("Self-test passed.\n");
+	return 0;
+}
+
 static void
 handle_signal (int sig)
 {
@@ -259,7 +1141,15 @@ handle_signal (int sig)
 
 static struct option const long_options[] =
     {
+      { "accelerate", required_argument, 0, 'a' },
+      { "baseline", required_argument, 0, 'b' },
+      { "compare", required_argument, 0, 'c' },
       { "help", no_argument, 0, 'h' },
+      { "narrowband", no_argument, 0, 'N' },
+      { "resources", required_argument, 0, 'r' },
+      { "selftest", required_argument, 0, 'T' },
+      { "shift", required_argument, 0, 's' },
+      { "time", required_argument, 0, 't' },
       { "version", no_argument, 0, 'V' },
       { "volume", required_argument, 0, 'l' },
       { NULL, 0, NULL, 0 }
@@ -272,10 +1162,25 @@ usage (int status)
 	printf ("Usage: ltc-delay [OPTION] [JACK-PORT-TO-CONNECT]*\n");
 	printf ("\n"
 	        "Options:\n"
+	        " -a, --accelerate <N>   run LTC at N times nominal speed (1..8, default: 1),\n"
+	        "                        limited to 6 samples per bit (x4 at 48kHz)\n"
+	        " -b, --baseline <file>  save measured delays as baseline on exit\n"
+	        " -c, --compare <file>   compare measured delays to baseline on exit,\n"
+	        "                        exit with status 1 on significant regression\n"
 	        " -h, --help             display this help and exit\n"
 	        " -i, --input <port>     connect input port (default: none)\n"
 	        " -l, --level <dBFS>     set output level in dBFS (default -6dBFS)\n"
+	        " -N, --narrowband       narrowband profile for 8-16kHz telephony and VoIP\n"
+	        "                        paths: half-speed LTC, band-limited edges,\n"
+	        "                        accept up to 2 sec delay\n"
 	        " -o, --output <port>    connect output port (default: none)\n"
+	        " -r, --resources <sec>  report own resource usage every <sec> seconds\n"
+	        "                        (default: 0, off)\n"
+	        " -s, --shift <ms>       smallest increase of the mean delay that counts as\n"
+	        "                        regression when comparing (default: 1 ms)\n"
+	        " -t, --time <sec>       measure for given time and exit (default: 0, unlimited)\n"
+	        " -T, --selftest <rate>  measure a simulated path at given sample-rate without\n"
+	        "                        JACK and verify the accuracy (exit status 1 on failure)\n"
 	        " -V, --version          print version information and exit\n"
 	        "\n"
 	        "\n"
@@ -289,15 +1194,32 @@ int
 main (int argc, char** argv)
 {
 	int   c;
-	char* input_port  = NULL;
-	char* output_port = NULL;
+	int   rv            = 0;
+	char* input_port    = NULL;
+	char* output_port   = NULL;
+	char* baseline_save = NULL;
+	char* baseline_cmp  = NULL;
+	int   selftest_rate = 0;
+
+	Histogram    baseline = { NULL, 0, 0, 0 };
+	unsigned int baseline_rate;
+	char         baseline_input[256];
+	char         baseline_output[256];
 
 	while ((c = getopt_long (argc, argv,
+	                         "a:" /* accelerate */
+	                         "b:" /* save baseline */
+	                         "c:" /* compare baseline */
 	                         "d"  /* debug-print */
 	                         "h"  /* help */
 	                         "i:" /* input_port */
 	                         "l:" /* loudnless/level */
+	                         "N"  /* narrowband */
 	                         "o:" /* output_port */
+	                         "r:" /* resource report interval */
+	                         "s:" /* regression threshold */
+	                         "t:" /* run time */
+	                         "T:" /* selftest */
 	                         "V"  /* version */
 	                         ,
 	                         long_options,
@@ -311,9 +1233,29 @@ main (int argc, char** argv)
 				    "warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\n");
 				exit (0);
 
+			case 'a':
+				accel = atoi (optarg);
+				if (accel < 1)
+					accel = 1;
+				if (accel > 8)
+					accel = 8;
+				break;
+
+			case 'b':
+				baseline_save = optarg;
+				break;
+
+			case 'c':
+				baseline_cmp = optarg;
+				break;
+
 			case 'h':
 				usage (0);
 
+			case 'N':
+				narrowband = 1;
+				break;
+
 			case 'l':
 				volume_dbfs = atof (optarg);
 				if (volume_dbfs > 0)
@@ -335,34 +1277,92 @@ main (int argc, char** argv)
 				output_port = optarg;
 				break;
 
+			case 'r':
+				res_interval = atoi (optarg);
+				break;
+
+			case 's':
+				min_shift_ms = atof (optarg);
+				if (min_shift_ms < 0)
+					min_shift_ms = 0;
+				break;
+
+			case 't':
+				run_time = atoi (optarg);
+				break;
+
+			case 'T':
+				selftest_rate = atoi (optarg);
+				if (selftest_rate < 8000)
+					selftest_rate = 8000;
+				if (selftest_rate > 192000)
+					selftest_rate = 192000;
+				break;
+
 			default:
 				usage (EXIT_FAILURE);
 		}
 	}
 
-	init_jack ();
+	if (baseline_cmp) {
+		if (hist_load (baseline_cmp, &baseline, &baseline_rate, baseline_input, baseline_output, sizeof (baseline_input))) {
+			return (EXIT_FAILURE);
+		}
+		if (strcmp (baseline_input, input_port ? input_port : "") || strcmp (baseline_output, output_port ? output_port : "")) {
+			fprintf (stderr, "Warning: baseline route '%s' -> '%s' differs from '%s' -> '%s'\n",
+			         baseline_output, baseline_input,
+			         output_port ? output_port : "", input_port ? input_port : "");
+		}
+	}
 
-	if (input_port) {
+	if (selftest_rate > 0) {
+		j_samplerate = selftest_rate;
+		init_buffers ();
+	} else {
+		init_jack ();
+	}
+
+	if (baseline_cmp && baseline_rate != j_samplerate) {
+		fprintf (stderr, "Error: baseline was measured at %u Hz, JACK runs at %u Hz\n", baseline_rate, j_samplerate);
+		cleanup (1);
+	}
+
+	if (input_port && j_client) {
 		if (jack_connect (j_client, input_port, jack_port_name (j_input_port))) {
 			fprintf (stderr, "Warning: Cannot connect port '%s' to '%s'\n", input_port, jack_port_name (j_input_port));
 		}
 	}
 
-	if (output_port) {
+	if (output_port && j_client) {
 		if (jack_connect (j_client, jack_port_name (j_output_port), output_port)) {
 			fprintf (stderr, "Warning: Cannot connect port '%s' to '%s'\n", jack_port_name (j_output_port), output_port);
 		}
 	}
 
-	encoder = ltc_encoder_create (j_samplerate, fps, LTC_TV_FILM_24 /* no offset */, 0);
-	decoder = ltc_decoder_create (j_samplerate / fps, 12);
+	init_ltc ();
 
 #ifndef WIN32
 	signal (SIGINT, handle_signal);
 #endif
 
-	main_loop ();
+	if (selftest_rate > 0) {
+		rv = selftest ();
+	} else {
+		main_loop ();
+	}
 	cleanup (0);
+
+	if (baseline_save && hist_save (baseline_save, &delay_hist, input_port, output_port)) {
+		rv = EXIT_FAILURE;
+	}
+
+	if (baseline_cmp && compare_baseline (&baseline, &delay_hist)) {
+		rv = EXIT_FAILURE;
+	}
+
+	hist_free (&baseline);
+	hist_free (&delay_hist);
+
 	printf ("ciao.\n");
-	return (0);
+	return (rv);
 }